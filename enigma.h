@@ -14,12 +14,47 @@
 // --------------------------------------------------------------
 // DATA STRUCTURES, DEFINES and TYPE ALIASES
 
+// The alphabet is chosen at compile time. By default the machine
+// works with the 26 capital letters of the english alphabet. Define
+// ENIGMA_BYTE_MODE to work with all 256 byte values instead, or define
+// both ALPHABET_SIZE and ENIGMA_ALPHABET to use a custom alphabet.
+//
+// The symbols of the alphabet can also be changed at init time with
+// init_alphabet(), as long as their number stays ALPHABET_SIZE.
+#ifdef ENIGMA_BYTE_MODE
+#define ALPHABET_SIZE 256
+#endif
+
+#ifndef ALPHABET_SIZE
 #define ALPHABET_SIZE 26
+#endif
+
+#ifndef ENIGMA_ALPHABET
+#define ENIGMA_ALPHABET "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+#endif
+
+#if ALPHABET_SIZE > 256
+#error "ALPHABET_SIZE cannot be greater than 256"
+#endif
+
+#if (ALPHABET_SIZE % 2) != 0
+#error "ALPHABET_SIZE must be even, otherwise the reflector cannot pair all symbols"
+#endif
+
+// Size of the alphabet used by the historical rotor and reflector
+// models. Every other alphabet gets generated wirings.
+#define CLASSIC_ALPHABET_SIZE 26
+
+// Code returned by CHAR2CODE() for symbols outside of the alphabet.
+// Never a valid code, unless the alphabet covers all 256 bytes.
+#define INVALID_CODE 0xFF
+
 #define PLUGBOARD_SIZE 10
 #define LABEL_LENGTH 42
 #define ROTORS_N 3
 
 typedef uint8_t u8;
+typedef uint32_t u32;
 typedef size_t usize;
 typedef u8 Wiring[ALPHABET_SIZE];
 
@@ -40,7 +75,7 @@ typedef struct {
 
 typedef struct {
   char name[LABEL_LENGTH];  
-  char wiring[ALPHABET_SIZE];  
+  char wiring[CLASSIC_ALPHABET_SIZE + 1];
   u8 notch;
 } RotorModel;
 
@@ -56,7 +91,7 @@ typedef struct {
 
 typedef struct {
   char name[LABEL_LENGTH];  
-  char wiring[ALPHABET_SIZE];
+  char wiring[CLASSIC_ALPHABET_SIZE + 1];
 } ReflectorModel;
 
 // To properly configure an Enigma machine you need four different settings:
@@ -73,13 +108,51 @@ typedef struct {
   Reflector reflector;
 } Enigma;
 
+#define CACHE_LINE_SIZE 64
+
+// Pool slots start on their own cache line, so that machines used by
+// different messages never share one.
+typedef struct {
+  _Alignas(CACHE_LINE_SIZE) Enigma enigma;
+} EnigmaSlot;
+
+// Machines and message buffers for batch workloads. Everything lives
+// in a single cache-line-aligned allocation made by init_enigma_pool(),
+// acquiring and releasing only push and pop free lists, and
+// destroy_enigma_pool() releases everything at once.
+//
+// A pool is not thread safe, use one pool per thread, and initialize
+// the alphabet before starting the threads.
+typedef struct {
+  EnigmaSlot *slots;
+  Enigma **free_machines;
+  u8 *machines_in_use;
+  usize machines_n;
+  usize free_machines_n;
+
+  u8 *buffers;
+  u8 **free_buffers;
+  u8 *buffers_in_use;
+  usize buffers_n;
+  usize free_buffers_n;
+  usize buffer_size;
+} EnigmaPool;
+
 // --------------------------------------------------------------
 // SIGNATURES, MACROS
 
-// TODO: expand this function so we can support a bigger alphabet and
-// not just english uppercase.
-#define CHAR2CODE(ch) ((u8) ((ch) - 'A'))
-#define CODE2CHAR(code) ((char) ('A' + (code)))
+// Translation between symbols and codes goes through 256 entries
+// lookup tables, so that any byte can be translated with a single
+// load. The tables are filled by init_alphabet().
+extern u8 CHAR2CODE_TABLE[256];
+extern u8 CODE2CHAR_TABLE[ALPHABET_SIZE];
+
+#define CHAR2CODE(ch) (CHAR2CODE_TABLE[(u8) (ch)])
+#define CODE2CHAR(code) ((char) CODE2CHAR_TABLE[(code)])
+
+// Rotor and reflector models are always written with the classic
+// uppercase letters, independently of the alphabet in use.
+#define LETTER2CODE(ch) ((u8) ((ch) - 'A'))
 
 // Function signatures
 Enigma *init_enigma(const char *rotor_names[ROTORS_N],
@@ -88,21 +161,53 @@ Enigma *init_enigma(const char *rotor_names[ROTORS_N],
                     const char *reflector_name,
 		    u8 (*plugboard)[2],
                     usize plugboard_size);
+void setup_enigma(Enigma *e,
+		  const char *rotor_names[ROTORS_N],
+		  const u8 rotor_positions[ROTORS_N],
+		  const u8 rotor_ring_settings[ROTORS_N],
+		  const char *reflector_name,
+		  u8 (*plugboard)[2],
+		  usize plugboard_size);
+
+EnigmaPool *init_enigma_pool(usize machines_n, usize buffers_n, usize buffer_size);
+Enigma *pool_acquire_enigma(EnigmaPool *p,
+			    const char *rotor_names[ROTORS_N],
+			    const u8 rotor_positions[ROTORS_N],
+			    const u8 rotor_ring_settings[ROTORS_N],
+			    const char *reflector_name,
+			    u8 (*plugboard)[2],
+			    usize plugboard_size);
+void pool_release_enigma(EnigmaPool *p, Enigma *e);
+u8 *pool_acquire_buffer(EnigmaPool *p);
+void pool_release_buffer(EnigmaPool *p, u8 *buffer);
+void destroy_enigma_pool(EnigmaPool *p);
+
+void init_alphabet(const char *alphabet, usize alphabet_len);
+void init_default_alphabet(void);
 
 void init_wiring(Wiring wiring, const char *alphabet, usize alphabet_len);
+void generate_rotor_wiring(Wiring wiring, const char *model_wiring);
+void generate_reflector_wiring(Wiring wiring, const char *model_wiring);
 void reverse_wiring(Wiring new_wiring, Wiring old_wiring, usize wiring_len);
 char *copy_str(const char *src, const usize length);
 
 void init_rotor(Rotor *r, const char *rotor_name, const u8 position, const u8 ring_settings);
 void init_rotors(Enigma *e, const char *rotor_names[ROTORS_N], const u8 rotor_positions[ROTORS_N], const u8 rotor_ring_settings[ROTORS_N]);
 void init_reflector(Enigma *e, const char *reflector_name);
+u8 valid_plugboard(u8 (*board)[2], usize plugboard_size);
+void init_plugboard(Enigma *e, u8 (*board)[2], usize plugboard_size);
 void destroy_enigma(Enigma *e);
 
 u8 apply_rotor(Rotor *r, const u8 plaintext_code, RotorOrder order);
 void move_rotors(Enigma *e);
 u8 apply_rotors(Enigma *e, const u8 plaintext_code, RotorOrder order);
 u8 apply_plugboard(Enigma *e, const u8 plaintext_code);
+void init_plugboard_table(const Enigma *e, u8 table[ALPHABET_SIZE]);
 u8 apply_reflector(Enigma *e, const u8 plaintext_code);
+u8 apply_rotor_offset(const Wiring wiring, const u8 offset, const u8 char_code);
+u8 rotor_offset(const Rotor *r);
+usize next_event_distance(const Enigma *e);
+void apply_enigma_reference(Enigma *e, const u8 *input, usize input_len, u8 *output);
 void apply_enigma(Enigma *e, const u8 *input, usize input_len, u8 *output);
 
 void enigma_encrypt(Enigma *e, const char *plaintext, usize plaintext_len, char *ciphertext);
@@ -116,11 +221,11 @@ void enigma_decrypt(Enigma *e, const char *ciphertext, usize ciphertext_len, cha
 // ENIGMA MODELS
 
 RotorModel KNOWN_ROTORS[] = {
-  {"M3-I", "EKMFLGDQVZNTOWYHXUSPAIBRCJ", CHAR2CODE('Q')},
-  {"M3-II", "AJDKSIRUXBLHWTMCQGZNPYFVOE", CHAR2CODE('E')},
-  {"M3-III", "BDFHJLCPRTXVZNYEIWGAKMUSQO", CHAR2CODE('V')},
-  {"M3-IV", "ESOVPZJAYQUIRHXLNFTGKDCMWB", CHAR2CODE('J')},
-  {"M3-V", "VZBRGITYUPSDNHLXAWMJQOFECK", CHAR2CODE('Z')},
+  {"M3-I", "EKMFLGDQVZNTOWYHXUSPAIBRCJ", LETTER2CODE('Q')},
+  {"M3-II", "AJDKSIRUXBLHWTMCQGZNPYFVOE", LETTER2CODE('E')},
+  {"M3-III", "BDFHJLCPRTXVZNYEIWGAKMUSQO", LETTER2CODE('V')},
+  {"M3-IV", "ESOVPZJAYQUIRHXLNFTGKDCMWB", LETTER2CODE('J')},
+  {"M3-V", "VZBRGITYUPSDNHLXAWMJQOFECK", LETTER2CODE('Z')},
 };
 
 ReflectorModel KNOWN_REFLECTORS[] = {
@@ -132,12 +237,114 @@ ReflectorModel KNOWN_REFLECTORS[] = {
 usize KNOWN_ROTORS_LENGTH = (sizeof(KNOWN_ROTORS)/sizeof(RotorModel));
 usize KNOWN_REFLECTORS_LENGTH = (sizeof(KNOWN_REFLECTORS)/sizeof(ReflectorModel));
 
+// --------------------------------------------------------------
+// ALPHABET
+
+u8 CHAR2CODE_TABLE[256];
+u8 CODE2CHAR_TABLE[ALPHABET_SIZE];
+
+// Set once the tables are filled. Plugboards hold codes of the current
+// alphabet, so the alphabet cannot change after that.
+u8 ALPHABET_INITIALIZED = 0;
+
+// Fills the translation tables so that alphabet[i] has code i. Every
+// other byte is translated to INVALID_CODE.
+//
+// Must be called at most once and before any machine is set up, and
+// the symbols must be distinct, otherwise decryption would not give
+// back the plaintext.
+void init_alphabet(const char *alphabet, usize alphabet_len) {
+  assert(alphabet_len == ALPHABET_SIZE && "init_alphabet(): alphabet_len != ALPHABET_SIZE");
+  assert(!ALPHABET_INITIALIZED && "init_alphabet(): alphabet already initialized");
+
+  u8 seen[256] = {0};
+  memset(CHAR2CODE_TABLE, INVALID_CODE, sizeof(CHAR2CODE_TABLE));
+  for (usize i = 0; i < alphabet_len; i++) {
+    assert(!seen[(u8) alphabet[i]] && "init_alphabet(): duplicate symbol in alphabet");
+    seen[(u8) alphabet[i]] = 1;
+
+    CHAR2CODE_TABLE[(u8) alphabet[i]] = (u8) i;
+    CODE2CHAR_TABLE[i] = (u8) alphabet[i];
+  }
+
+  ALPHABET_INITIALIZED = 1;
+}
+
+// Otherwise called by the first setup_enigma(), which is not thread
+// safe. Programs setting up machines from several threads must call
+// this, or init_alphabet(), before starting them.
+void init_default_alphabet(void) {
+#ifdef ENIGMA_BYTE_MODE
+  assert(!ALPHABET_INITIALIZED && "init_default_alphabet(): alphabet already initialized");
+
+  // Every byte is a symbol of its own, which cannot be expressed with
+  // a NULL-terminated string.
+  for (usize i = 0; i < ALPHABET_SIZE; i++) {
+    CHAR2CODE_TABLE[i] = (u8) i;
+    CODE2CHAR_TABLE[i] = (u8) i;
+  }
+  ALPHABET_INITIALIZED = 1;
+#else
+  init_alphabet(ENIGMA_ALPHABET, strlen(ENIGMA_ALPHABET));
+#endif
+}
+
 // --------------------------------------------------------------
 // UTILS
 
 void init_wiring(Wiring wiring, const char *alphabet, usize alphabet_len) {
   for (usize i = 0; i < alphabet_len; i++) {
-    wiring[i] = CHAR2CODE(alphabet[i]);
+    wiring[i] = LETTER2CODE(alphabet[i]);
+  }
+}
+
+// Alphabets other than the classic one have no historical wiring, so
+// we generate one from the classic wiring of the model. The classic
+// wiring seeds a xorshift PRNG, which means that each model keeps a
+// distinct wiring that is the same across runs.
+u32 wiring_seed(const char *model_wiring) {
+  // FNV-1a
+  u32 seed = 2166136261u;
+  for (usize i = 0; i < CLASSIC_ALPHABET_SIZE; i++) {
+    seed = (seed ^ (u8) model_wiring[i]) * 16777619u;
+  }
+  return seed ? seed : 1;
+}
+
+u32 xorshift32(u32 *state) {
+  u32 x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+void shuffle_codes(u8 *codes, usize codes_len, u32 seed) {
+  for (usize i = 0; i < codes_len; i++) {
+    codes[i] = (u8) i;
+  }
+  // Fisher-Yates
+  for (usize i = codes_len - 1; i > 0; i--) {
+    usize j = xorshift32(&seed) % (i + 1);
+    u8 tmp = codes[i];
+    codes[i] = codes[j];
+    codes[j] = tmp;
+  }
+}
+
+void generate_rotor_wiring(Wiring wiring, const char *model_wiring) {
+  shuffle_codes(wiring, ALPHABET_SIZE, wiring_seed(model_wiring));
+}
+
+// A reflector must be an involution without fixed points, so we pair
+// up consecutive symbols of a shuffled alphabet.
+void generate_reflector_wiring(Wiring wiring, const char *model_wiring) {
+  u8 codes[ALPHABET_SIZE];
+  shuffle_codes(codes, ALPHABET_SIZE, wiring_seed(model_wiring));
+  for (usize i = 0; i < ALPHABET_SIZE; i += 2) {
+    wiring[codes[i]] = codes[i + 1];
+    wiring[codes[i + 1]] = codes[i];
   }
 }
 
@@ -167,12 +374,18 @@ void init_rotor(Rotor *r, const char *rotor_name, const u8 position, const u8 ri
       char *known_wiring  = KNOWN_ROTORS[i].wiring;
       u8    known_notch   = KNOWN_ROTORS[i].notch;
 
+#if ALPHABET_SIZE == CLASSIC_ALPHABET_SIZE
       init_wiring(r->forward_wiring, known_wiring, ALPHABET_SIZE);
+#else
+      generate_rotor_wiring(r->forward_wiring, known_wiring);
+#endif
       reverse_wiring(r->backward_wiring, r->forward_wiring, ALPHABET_SIZE);
 
-      r->notch = known_notch;      
-      r->position = position;
-      r->ring = ring;
+      r->notch = known_notch % ALPHABET_SIZE;
+      // Positions and rings past the end of the alphabet wrap around,
+      // so that stepping and spans only ever see codes of the alphabet.
+      r->position = position % ALPHABET_SIZE;
+      r->ring = ring % ALPHABET_SIZE;
 
       // copy also NULL-terminating byte
       memcpy(r->name, known_name, strlen(known_name) + 1);
@@ -213,8 +426,12 @@ void init_reflector(Enigma *e, const char *reflector_name) {
       char *known_name   = KNOWN_REFLECTORS[i].name;
       char *known_wiring = KNOWN_REFLECTORS[i].wiring;
 
+#if ALPHABET_SIZE == CLASSIC_ALPHABET_SIZE
       init_wiring(e->reflector.wiring, known_wiring, ALPHABET_SIZE);
-      
+#else
+      generate_reflector_wiring(e->reflector.wiring, known_wiring);
+#endif
+
       // copy also NULL-terminating byte
       memcpy(e->reflector.name, known_name, strlen(known_name) + 1);
     }
@@ -226,7 +443,23 @@ void init_reflector(Enigma *e, const char *reflector_name) {
   
 }
 
+// A plugboard is valid if it fits in PLUGBOARD_SIZE plugs and every
+// plug connects symbols of the alphabet in use.
+u8 valid_plugboard(u8 (*board)[2], usize plugboard_size) {
+  if (plugboard_size > PLUGBOARD_SIZE) {
+    return 0;
+  }
+  for (usize i = 0; i < plugboard_size; i++) {
+    if (CHAR2CODE(board[i][0]) >= ALPHABET_SIZE || CHAR2CODE(board[i][1]) >= ALPHABET_SIZE) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
 void init_plugboard(Enigma *e, u8(*board)[2], usize plugboard_size) {
+  assert(valid_plugboard(board, plugboard_size) && "init_plugboard(): invalid plugboard");
+
   e->plugboard.board_size = plugboard_size;
   for(usize i = 0; i < plugboard_size; i++) {
     e->plugboard.board[i][0] = CHAR2CODE(board[i][0]);
@@ -234,23 +467,47 @@ void init_plugboard(Enigma *e, u8(*board)[2], usize plugboard_size) {
   }
 }
 
-Enigma *init_enigma(const char *rotor_names[ROTORS_N],
-		    const u8 rotor_positions[ROTORS_N],
-		    const u8 rotor_ring_settings[ROTORS_N],
-                    const char *reflector_name,
-		    u8 (*plugboard)[2],
-                    usize plugboard_size) {
+// Configures the machine pointed by e, without allocating it.
+void setup_enigma(Enigma *e,
+		  const char *rotor_names[ROTORS_N],
+		  const u8 rotor_positions[ROTORS_N],
+		  const u8 rotor_ring_settings[ROTORS_N],
+		  const char *reflector_name,
+		  u8 (*plugboard)[2],
+		  usize plugboard_size) {
 
   if (plugboard_size > PLUGBOARD_SIZE) {
-    printf("[ERROR]: init_enigma() - supplied plugboard size (%ld) greater than maxium (%d)\n", plugboard_size, PLUGBOARD_SIZE);
+    printf("[ERROR]: setup_enigma() - supplied plugboard size (%ld) greater than maxium (%d)\n", plugboard_size, PLUGBOARD_SIZE);
     exit(0);
   }
 
-  Enigma *e = calloc(1, sizeof(Enigma));
-  
+  if (!ALPHABET_INITIALIZED) {
+    init_default_alphabet();
+  }
+
+  if (!valid_plugboard(plugboard, plugboard_size)) {
+    printf("[ERROR]: setup_enigma() - supplied plugboard connects symbols outside of the alphabet\n");
+    exit(0);
+  }
+
+  memset(e, 0, sizeof(Enigma));
+
   init_rotors(e, rotor_names, rotor_positions, rotor_ring_settings);
   init_reflector(e, reflector_name);
   init_plugboard(e, plugboard, plugboard_size);
+}
+
+Enigma *init_enigma(const char *rotor_names[ROTORS_N],
+		    const u8 rotor_positions[ROTORS_N],
+		    const u8 rotor_ring_settings[ROTORS_N],
+                    const char *reflector_name,
+		    u8 (*plugboard)[2],
+                    usize plugboard_size) {
+
+  Enigma *e = calloc(1, sizeof(Enigma));
+
+  setup_enigma(e, rotor_names, rotor_positions, rotor_ring_settings,
+	       reflector_name, plugboard, plugboard_size);
   
   return e;
 }
@@ -268,6 +525,161 @@ void destroy_enigma(Enigma *e) {
   }
 }
 
+// --------------------------------------------------------------
+// POOLS
+
+usize round_to_cache_line(usize size) {
+  return (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+// Bytes taken by n elements of the given size, rounded up to whole
+// cache lines. Returns SIZE_MAX, which is never a multiple of a cache
+// line, when they do not fit in a usize.
+usize region_bytes(usize n, usize size) {
+  if (size != 0 && n > (SIZE_MAX - (CACHE_LINE_SIZE - 1)) / size) {
+    return SIZE_MAX;
+  }
+  return round_to_cache_line(n * size);
+}
+
+// The single allocation is laid out as follows, with each region
+// starting on a cache line:
+//
+//   [EnigmaPool][slots][buffers][free_machines][free_buffers][in_use flags]
+//
+// buffer_size is rounded up to a whole number of cache lines. Returns
+// NULL when the allocation fails or its size does not fit in a usize.
+EnigmaPool *init_enigma_pool(usize machines_n, usize buffers_n, usize buffer_size) {
+  assert((buffers_n == 0 || buffer_size > 0) && "init_enigma_pool(): buffers must not be empty");
+  buffer_size = region_bytes(buffer_size, 1);
+  if (buffer_size == SIZE_MAX || machines_n > SIZE_MAX - buffers_n) {
+    return NULL;
+  }
+
+  usize regions[] = {
+    region_bytes(1, sizeof(EnigmaPool)),
+    region_bytes(machines_n, sizeof(EnigmaSlot)),
+    region_bytes(buffers_n, buffer_size),
+    region_bytes(machines_n, sizeof(Enigma *)),
+    region_bytes(buffers_n, sizeof(u8 *)),
+    region_bytes(machines_n + buffers_n, 1),
+  };
+  usize header_bytes        = regions[0];
+  usize slots_bytes         = regions[1];
+  usize buffers_bytes       = regions[2];
+  usize free_machines_bytes = regions[3];
+  usize free_buffers_bytes  = regions[4];
+
+  usize total = 0;
+  for (usize i = 0; i < sizeof(regions)/sizeof(regions[0]); i++) {
+    if (regions[i] == SIZE_MAX || total > SIZE_MAX - regions[i]) {
+      return NULL;
+    }
+    total += regions[i];
+  }
+  u8 *block = aligned_alloc(CACHE_LINE_SIZE, total);
+  if (!block) {
+    return NULL;
+  }
+
+  EnigmaPool *p = (EnigmaPool *) block;
+  block += header_bytes;
+  p->slots = (EnigmaSlot *) block;
+  block += slots_bytes;
+  p->buffers = block;
+  block += buffers_bytes;
+  p->free_machines = (Enigma **) block;
+  block += free_machines_bytes;
+  p->free_buffers = (u8 **) block;
+  block += free_buffers_bytes;
+  p->machines_in_use = block;
+  p->buffers_in_use = block + machines_n;
+  memset(block, 0, machines_n + buffers_n);
+
+  p->machines_n = machines_n;
+  p->buffers_n = buffers_n;
+  p->buffer_size = buffer_size;
+
+  // Free lists are stacks, filled so that the first acquire returns the
+  // first slot.
+  p->free_machines_n = machines_n;
+  for (usize i = 0; i < machines_n; i++) {
+    p->free_machines[i] = &p->slots[machines_n - 1 - i].enigma;
+  }
+  p->free_buffers_n = buffers_n;
+  for (usize i = 0; i < buffers_n; i++) {
+    p->free_buffers[i] = p->buffers + (buffers_n - 1 - i) * buffer_size;
+  }
+
+  return p;
+}
+
+// Same as init_enigma(), but the machine is taken from the pool.
+// Returns NULL when all the machines of the pool are in use.
+Enigma *pool_acquire_enigma(EnigmaPool *p,
+			    const char *rotor_names[ROTORS_N],
+			    const u8 rotor_positions[ROTORS_N],
+			    const u8 rotor_ring_settings[ROTORS_N],
+			    const char *reflector_name,
+			    u8 (*plugboard)[2],
+			    usize plugboard_size) {
+  if (p->free_machines_n == 0) {
+    return NULL;
+  }
+
+  Enigma *e = p->free_machines[--p->free_machines_n];
+  p->machines_in_use[(EnigmaSlot *) e - p->slots] = 1;
+  setup_enigma(e, rotor_names, rotor_positions, rotor_ring_settings,
+	       reflector_name, plugboard, plugboard_size);
+
+  return e;
+}
+
+void pool_release_enigma(EnigmaPool *p, Enigma *e) {
+  usize offset = (usize) ((u8 *) e - (u8 *) p->slots);
+  assert((u8 *) e >= (u8 *) p->slots && offset < p->machines_n * sizeof(EnigmaSlot)
+	 && "pool_release_enigma(): machine does not belong to the pool");
+  assert(offset % sizeof(EnigmaSlot) == 0 && "pool_release_enigma(): pointer is not the start of a slot");
+
+  usize index = offset / sizeof(EnigmaSlot);
+  assert(p->machines_in_use[index] && "pool_release_enigma(): machine released twice");
+
+  p->machines_in_use[index] = 0;
+  p->free_machines[p->free_machines_n++] = e;
+}
+
+// Returns a buffer of p->buffer_size bytes, or NULL when all the
+// buffers of the pool are in use.
+u8 *pool_acquire_buffer(EnigmaPool *p) {
+  if (p->free_buffers_n == 0) {
+    return NULL;
+  }
+  u8 *buffer = p->free_buffers[--p->free_buffers_n];
+  p->buffers_in_use[(usize) (buffer - p->buffers) / p->buffer_size] = 1;
+  return buffer;
+}
+
+void pool_release_buffer(EnigmaPool *p, u8 *buffer) {
+  usize offset = (usize) (buffer - p->buffers);
+  assert(buffer >= p->buffers && offset < p->buffers_n * p->buffer_size
+	 && "pool_release_buffer(): buffer does not belong to the pool");
+  assert(offset % p->buffer_size == 0 && "pool_release_buffer(): pointer is not the start of a buffer");
+
+  usize index = offset / p->buffer_size;
+  assert(p->buffers_in_use[index] && "pool_release_buffer(): buffer released twice");
+
+  p->buffers_in_use[index] = 0;
+  p->free_buffers[p->free_buffers_n++] = buffer;
+}
+
+// Releases the pool together with all its machines and buffers, even
+// the ones still in use.
+void destroy_enigma_pool(EnigmaPool *p) {
+  if (p) {
+    free(p);
+  }
+}
+
 // --------------------------------------------------------------
 // CORE LOGIC
 
@@ -339,11 +751,30 @@ u8 apply_plugboard(Enigma *e, const u8 plaintext_code) {
   return plaintext_code;
 }
 
+// Flattens the plugboard into a lookup table, so that
+// table[code] == apply_plugboard(e, code). Pairs are visited backwards
+// so that, just like in apply_plugboard(), the first matching pair
+// wins.
+void init_plugboard_table(const Enigma *e, u8 table[ALPHABET_SIZE]) {
+  for (usize i = 0; i < ALPHABET_SIZE; i++) {
+    table[i] = (u8) i;
+  }
+  for (usize i = e->plugboard.board_size; i > 0; i--) {
+    assert(e->plugboard.board[i - 1][0] < ALPHABET_SIZE && e->plugboard.board[i - 1][1] < ALPHABET_SIZE
+	   && "init_plugboard_table(): plug outside of the alphabet");
+    table[e->plugboard.board[i - 1][0]] = e->plugboard.board[i - 1][1];
+    table[e->plugboard.board[i - 1][1]] = e->plugboard.board[i - 1][0];
+  }
+}
+
 u8 apply_reflector(Enigma *e, const u8 plaintext_code) {
   return e->reflector.wiring[plaintext_code];
 }
 
-void apply_enigma(Enigma *e, const u8 *input, usize input_len, u8 *output) {
+// Straightforward implementation, which steps the rotors and walks the
+// plugboard for every single character. Kept as the reference that
+// every faster path is checked against.
+void apply_enigma_reference(Enigma *e, const u8 *input, usize input_len, u8 *output) {
   // Assumes output has been already allocated with a null-terminating
   // string and that len(output) == input_len.
 
@@ -353,6 +784,15 @@ void apply_enigma(Enigma *e, const u8 *input, usize input_len, u8 *output) {
     // Transform character into char_code
     u8 char_code = CHAR2CODE(input_char);
 
+#if ALPHABET_SIZE < 256
+    // Symbols outside of the alphabet are left as they are and do not
+    // move the rotors, just like a key missing from the keyboard.
+    if (char_code == INVALID_CODE) {
+      output[i] = input_char;
+      continue;
+    }
+#endif
+
     // Movement is executed before encryption
     move_rotors(e);
     
@@ -368,12 +808,116 @@ void apply_enigma(Enigma *e, const u8 *input, usize input_len, u8 *output) {
     char_code = apply_plugboard(e, char_code);
 
     // Transform char_code into character
-    u8 output_char = CODE2CHAR(char_code);
+    u8 output_char = (u8) CODE2CHAR(char_code);
 
     output[i] = output_char;
   }
 }
 
+// Same as apply_rotor(), but with the offset of the rotor already
+// computed by rotor_offset().
+//
+// Both sums are below 2 * ALPHABET_SIZE, so a conditional subtraction
+// is enough to wrap them around instead of a modulo.
+u8 apply_rotor_offset(const Wiring wiring, const u8 offset, const u8 char_code) {
+  usize index = (usize) char_code + offset;
+  index -= (index >= ALPHABET_SIZE) ? ALPHABET_SIZE : 0;
+
+  usize code = (usize) wiring[index] + ALPHABET_SIZE - offset;
+  code -= (code >= ALPHABET_SIZE) ? ALPHABET_SIZE : 0;
+
+  return (u8) code;
+}
+
+u8 rotor_offset(const Rotor *r) {
+  return (u8) ((r->position + ALPHABET_SIZE - r->ring) % ALPHABET_SIZE);
+}
+
+// The stepping sequence is fully determined by the rotor positions.
+// Returns how many keypresses, starting from the current state, only
+// move the right rotor. The keypress right after them is a notch
+// event, which moves the middle rotor too (and with double stepping
+// also the left one).
+usize next_event_distance(const Enigma *e) {
+  if (e->rotors[1].position == e->rotors[1].notch) {
+    return 0;
+  }
+  return (e->rotors[0].notch + ALPHABET_SIZE - e->rotors[0].position) % ALPHABET_SIZE;
+}
+
+// Same result of apply_enigma_reference(), but the input is processed
+// in spans between two notch events. Within a span the middle and left
+// rotors stand still, so their offsets are computed once and the
+// characters are encrypted without any stepping check. Only the event
+// keypress at the end of a span goes through move_rotors().
+void apply_enigma(Enigma *e, const u8 *input, usize input_len, u8 *output) {
+  // Assumes output has been already allocated with a null-terminating
+  // string and that len(output) == input_len.
+
+  u8 plugboard[ALPHABET_SIZE];
+  init_plugboard_table(e, plugboard);
+
+  Rotor *r0 = &e->rotors[0];
+  Rotor *r1 = &e->rotors[1];
+  Rotor *r2 = &e->rotors[2];
+
+  usize i = 0;
+  while (i < input_len) {
+    usize span = next_event_distance(e);
+
+    const u8 o1 = rotor_offset(r1);
+    const u8 o2 = rotor_offset(r2);
+    u8 p0 = r0->position;
+
+    for (; i < input_len; i++) {
+      u8 char_code = CHAR2CODE(input[i]);
+
+#if ALPHABET_SIZE < 256
+      if (char_code == INVALID_CODE) {
+	output[i] = input[i];
+	continue;
+      }
+#endif
+
+      if (span == 0) {
+	break;
+      }
+      span--;
+
+      p0 = (u8) ((p0 + 1) % ALPHABET_SIZE);
+      const u8 o0 = (u8) ((p0 + ALPHABET_SIZE - r0->ring) % ALPHABET_SIZE);
+
+      char_code = plugboard[char_code];
+      char_code = apply_rotor_offset(r0->forward_wiring, o0, char_code);
+      char_code = apply_rotor_offset(r1->forward_wiring, o1, char_code);
+      char_code = apply_rotor_offset(r2->forward_wiring, o2, char_code);
+      char_code = e->reflector.wiring[char_code];
+      char_code = apply_rotor_offset(r2->backward_wiring, o2, char_code);
+      char_code = apply_rotor_offset(r1->backward_wiring, o1, char_code);
+      char_code = apply_rotor_offset(r0->backward_wiring, o0, char_code);
+      char_code = plugboard[char_code];
+
+      output[i] = (u8) CODE2CHAR(char_code);
+    }
+
+    r0->position = p0;
+
+    if (i < input_len) {
+      // Notch event, input[i] is known to be in the alphabet
+      move_rotors(e);
+
+      u8 char_code = plugboard[CHAR2CODE(input[i])];
+      char_code = apply_rotors(e, char_code, RO_FORWARD);
+      char_code = apply_reflector(e, char_code);
+      char_code = apply_rotors(e, char_code, RO_BACKWARD);
+      char_code = plugboard[char_code];
+
+      output[i] = (u8) CODE2CHAR(char_code);
+      i++;
+    }
+  }
+}
+
 void enigma_encrypt(Enigma* e, const char* plaintext, usize plaintext_len, char* ciphertext) {
   assert(plaintext_len == strlen(ciphertext) && "enigma_encrypt(): strlen(ciphertext) != plaintext_len");
   apply_enigma(e, (const u8*)plaintext, plaintext_len, (u8*) ciphertext);
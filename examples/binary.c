@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#define ENIGMA_BYTE_MODE
+#define ENIGMA_IMPLEMENTATION
+#include "../enigma.h"
+
+// --------------------------------------------------------------
+
+#define PAYLOAD_SIZE 1024
+
+Enigma *make_enigma(void) {
+  return init_enigma (
+		      // rotors model
+		      (const char *[]){"M3-II", "M3-I", "M3-III"},
+		      // rotor_positions
+		      (const uint8_t [ROTORS_N]) {0, 0, 0},
+		      // rotor_ring_settings
+		      (const uint8_t [ROTORS_N]) {0, 0, 0},
+		      // reflector model
+		      "M3-B",
+		      // plugboard switches, any byte can be plugged
+		      (uint8_t [][2]){
+			{0x00, 0xFF}, {'A', 'z'}, {'\n', ' '}},
+		      // plugboard size
+		      3
+		      );
+}
+
+int main() {
+  Enigma *e1 = make_enigma();
+  Enigma *e2 = make_enigma();
+
+  // ------------------
+
+  // Arbitrary binary payload, NULL bytes included
+  uint8_t payload[PAYLOAD_SIZE];
+  uint8_t encrypted[PAYLOAD_SIZE];
+  uint8_t decrypted[PAYLOAD_SIZE];
+
+  for (size_t i = 0; i < PAYLOAD_SIZE; i++) {
+    payload[i] = (uint8_t) (i * 7);
+  }
+
+  apply_enigma(e1, payload, PAYLOAD_SIZE, encrypted);
+  apply_enigma(e2, encrypted, PAYLOAD_SIZE, decrypted);
+
+  printf("Encrypted: ");
+  for (size_t i = 0; i < 16; i++) {
+    printf("%02x ", encrypted[i]);
+  }
+  printf("...\n");
+  printf("Decrypted matches payload: %s\n",
+	 memcmp(payload, decrypted, PAYLOAD_SIZE) == 0 ? "yes" : "no");
+
+  // ------------------
+
+  destroy_enigma(e1);
+  destroy_enigma(e2);
+
+  return 0;
+}
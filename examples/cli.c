@@ -10,6 +10,7 @@
 #include "../enigma.h"
 
 #define MAX_ARGS 128
+#define MAX_MESSAGE_LEN 4096
 
 // ----------------------------------------
 
@@ -41,6 +42,9 @@ void execute_decrypt(char **args, size_t n_args);
 
 // ----------------------------------------
 
+// Both the machine and the message buffers are taken from the pool,
+// so that long inputs are never copied on the stack.
+EnigmaPool *POOL;
 Enigma *ENIGMA;
 
 // NOTE: Be careful, because the specific index of these functions
@@ -176,14 +180,17 @@ void set_rotor(char **args, size_t n_args) {
   }
 
   // TODO: add more checks here?
-  rotor_position = atoi(pos);
-  rotor_ring = atoi(ring);
+  int position_arg = atoi(pos);
+  int ring_arg = atoi(ring);
   
-  if ((rotor_position < 0 || rotor_position > 25) && (rotor_ring < 0 || rotor_ring > 25)) {
-    printf("Enigma> rotor position and ring settings must be positive integers between 0 and 25!\n");
+  if ((position_arg < 0 || position_arg >= ALPHABET_SIZE) || (ring_arg < 0 || ring_arg >= ALPHABET_SIZE)) {
+    printf("Enigma> rotor position and ring settings must be positive integers between 0 and %d!\n", ALPHABET_SIZE - 1);
     return;      
   }
 
+  rotor_position = (uint8_t) position_arg;
+  rotor_ring = (uint8_t) ring_arg;
+
   // DEBUG
   // printf("rotor_name = %s, len(rotor_name) = %ld, rotor_index = %d, rotor_position = %d, rotor_ring = %d\n",
   // 	   rotor_name, strlen(rotor_name), rotor_index, rotor_position, rotor_ring);
@@ -216,10 +223,19 @@ void set_plugboard(char **args, size_t n_args) {
   for(size_t i = 0; i < n_args; i++) {
     char *l1 = strtok(*args++, "-");
     char *l2 = strtok(NULL, "-");
+    if (l1 == NULL || l2 == NULL) {
+      printf("Enigma> plugs must be written as <L1-L2>!\n");
+      return;
+    }
     board[i][0] = l1[0];
     board[i][1] = l2[0];
   }
 
+  if (!valid_plugboard(board, board_size)) {
+    printf("Enigma> plugboard accepts at most %d plugs between letters of the alphabet!\n", PLUGBOARD_SIZE);
+    return;
+  }
+
   init_plugboard(ENIGMA, board, board_size);
 }
 
@@ -254,12 +270,19 @@ void execute_encrypt(char **args, size_t n_args) {
   char *plaintext = *args++;
   n_args--;
   size_t plaintext_length = strlen(plaintext);
-  
-  char ciphertext[plaintext_length];
+
+  if (plaintext_length + 1 > POOL->buffer_size) {
+    printf("Enigma> plaintext must be shorter than %ld characters!\n", POOL->buffer_size);
+    return;
+  }
+
+  char *ciphertext = (char *) pool_acquire_buffer(POOL);
   memcpy(ciphertext, plaintext, plaintext_length + 1);
   
   enigma_encrypt(ENIGMA, plaintext, plaintext_length, ciphertext);
   printf("%s\n", ciphertext);
+
+  pool_release_buffer(POOL, (uint8_t *) ciphertext);
 }
 
 void execute_decrypt(char **args, size_t n_args) {
@@ -272,18 +295,32 @@ void execute_decrypt(char **args, size_t n_args) {
   n_args--;
   size_t ciphertext_length = strlen(ciphertext);
 
-  char plaintext[ciphertext_length];
+  if (ciphertext_length + 1 > POOL->buffer_size) {
+    printf("Enigma> ciphertext must be shorter than %ld characters!\n", POOL->buffer_size);
+    return;
+  }
+
+  char *plaintext = (char *) pool_acquire_buffer(POOL);
   memcpy(plaintext, ciphertext, ciphertext_length + 1);  
 
   enigma_decrypt(ENIGMA, ciphertext, ciphertext_length, plaintext);
   printf("%s\n", plaintext);
+
+  pool_release_buffer(POOL, (uint8_t *) plaintext);
 }
 
 // ----------------------------------------
 
 int main(void) {
+  POOL = init_enigma_pool(1, 1, MAX_MESSAGE_LEN);
+  if (!POOL) {
+    printf("[ERROR]: could not allocate the pool\n");
+    exit(1);
+  }
+
   // default enigma
-  ENIGMA = init_enigma((const char *[]){"M3-II", "M3-I", "M3-III"},   // rotors_names
+  ENIGMA = pool_acquire_enigma(POOL,
+		       (const char *[]){"M3-II", "M3-I", "M3-III"},   // rotors_names
 		       (const uint8_t [ROTORS_N]) {0, 0, 0}, // rotor_positions
 		       (const uint8_t [ROTORS_N]) {0, 0, 0}, // rotor_ring_settings			
 		       "M3-B",                                  // reflector
@@ -294,6 +331,11 @@ int main(void) {
 		       },
 		       6                                      // plugboard size
 		       );
+  if (!ENIGMA) {
+    printf("[ERROR]: could not acquire a machine from the pool\n");
+    destroy_enigma_pool(POOL);
+    exit(1);
+  }
   
   // REPL
   int done = 0;  
@@ -320,7 +362,7 @@ int main(void) {
     free(buff);
   }
 
-  destroy_enigma(ENIGMA);
+  destroy_enigma_pool(POOL);
   
   return 0;
 }
@@ -0,0 +1,542 @@
+// Differential conformance and performance-regression harness.
+//
+// Every kernel is compared against apply_enigma_reference() on
+// random configurations and against published sample messages. On
+// request the speedup of each kernel over the reference is compared
+// against the baseline stored in tests/baseline.txt. Timings are too
+// noisy on shared machines to gate every run, so this is opt-in.
+//
+//   ./tests/harness                     run the conformance checks
+//   ./tests/harness --bench             also compare against the baseline
+//   ./tests/harness --update-baseline   also store the current speedups
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// The harness is also built in byte mode, together with kernels
+// generated for it, see the Makefile.
+#ifndef ENIGMA_KERNELS
+#define ENIGMA_KERNELS "../enigma_kernels.h"
+#endif
+
+#define ENIGMA_IMPLEMENTATION
+#include "../enigma.h"
+#include ENIGMA_KERNELS
+
+#define ROUNDS 5000
+#define MAX_MESSAGE_LEN 2048
+
+#define BASELINE_PATH "tests/baseline.txt"
+#define BENCH_MESSAGE_LEN (1 << 20)
+#define BENCH_REPEATS 15
+#define MAX_KERNELS 8
+
+// Speedup over the reference may be this much lower than the baseline
+// before failing, to absorb the noise of a shared machine.
+#define BENCH_TOLERANCE 0.25
+
+// Loose lower bound on the throughput of the reference, in Mchars/s,
+// which catches a reference that became slow along with every kernel.
+#define REFERENCE_FLOOR 2.0
+
+// --------------------------------------------------------------
+// KERNELS UNDER TEST
+
+// Every M3 configuration has a generated kernel. Falling back to
+// apply_enigma() would compare a path with itself, so it is an error.
+void apply_generated_kernel(Enigma *e, const u8 *input, usize input_len, u8 *output) {
+  EnigmaKernel kernel = select_kernel(e);
+  if (kernel == apply_enigma) {
+    printf("ERROR: no kernel for %s %s %s %s\n",
+	   e->rotors[2].name, e->rotors[1].name, e->rotors[0].name, e->reflector.name);
+    exit(1);
+  }
+  kernel(e, input, input_len, output);
+}
+
+typedef struct {
+  const char *name;
+  EnigmaKernel kernel;
+} KernelUnderTest;
+
+KernelUnderTest KERNELS_UNDER_TEST[] = {
+  {"reference", apply_enigma_reference},
+  {"spans", apply_enigma},
+  {"generated", apply_generated_kernel},
+};
+
+usize KERNELS_UNDER_TEST_LENGTH = (sizeof(KERNELS_UNDER_TEST)/sizeof(KernelUnderTest));
+
+// --------------------------------------------------------------
+// SAMPLE MESSAGES
+
+// http://wiki.franklinheath.co.uk/index.php/Enigma/Sample_Messages
+typedef struct {
+  const char *name;
+  const char *rotor_names[ROTORS_N];
+  u8 positions[ROTORS_N];
+  u8 rings[ROTORS_N];
+  const char *reflector_name;
+  const char *plugboard;
+  const char *input;
+  const char *output;
+} SampleMessage;
+
+SampleMessage SAMPLE_MESSAGES[] = {
+  {"Enigma Instruction Manual, 1930",
+   {"M3-II", "M3-I", "M3-III"}, {0, 1, 11}, {23, 12, 21}, "M3-A",
+   "AM FI NV PS TU WZ",
+   "GCDSEAHUGWTQGRKVLFGXUCALXVYMIGMMNMFDXTGNVHVRMMEVOUYFZSLRHDRRXFJWCFHUHMUNZEFRDISIKBGPMYVXUZ",
+   "FEINDLIQEINFANTERIEKOLONNEBEOBAQTETXANFANGSUEDAUSGANGBAERWALDEXENDEDREIKMOSTWAERTSNEUSTADT"},
+  {"Operation Barbarossa, 1941",
+   {"M3-II", "M3-IV", "M3-V"}, {1, 11, 0}, {1, 20, 11}, "M3-B",
+   "AV BS CG DL FU HZ IN KM OW RX",
+   "EDPUDNRGYSZRCXNUYTPOMRMBOFKTBZREZKMLXLVEFGUEYSIOZVEQMIKUBPMMYLKLTTDEISMDICAGYKUACTCDOMOHWXMUUIAUBSTSLRNBZSZWNRFXWFYSSXJZVIJHIDISHPRKLKAYUPADTXQSPINQMATLPIFSVKDASCTACDPBOPVHJK",
+   "AUFKLXABTEILUNGXVONXKURTINOWAXKURTINOWAXNORDWESTLXSEBEZXSEBEZXUAFFLIEGERSTRASZERIQTUNGXDUBROWKIXDUBROWKIXOPOTSCHKAXOPOTSCHKAXUMXEINSAQTDREINULLXUHRANGETRETENXANGRIFFXINFXRGTX"},
+  {"README, default machine",
+   {"M3-II", "M3-I", "M3-III"}, {0, 0, 0}, {0, 0, 0}, "M3-B",
+   "AM FI NV PS TU WZ",
+   "HELLO",
+   "MIJEN"},
+  {"CLI, plugboard B-Q C-R",
+   {"M3-I", "M3-II", "M3-III"}, {0, 0, 0}, {0, 0, 0}, "M3-B",
+   "BQ CR",
+   "DSFSDFSDF",
+   "MXUNIBVUQ"},
+  {"README, custom positions and rings",
+   {"M3-I", "M3-II", "M3-III"}, {1, 3, 5}, {2, 4, 6}, "M3-B",
+   "BQ CR",
+   "DSFSDFSDF",
+   "SCLMEEYMV"},
+};
+
+usize SAMPLE_MESSAGES_LENGTH = (sizeof(SAMPLE_MESSAGES)/sizeof(SampleMessage));
+
+// --------------------------------------------------------------
+// CONFIGURATIONS
+
+void sample_enigma(Enigma *e, SampleMessage *s) {
+  u8 board[PLUGBOARD_SIZE][2];
+  usize board_size = 0;
+  for (const char *p = s->plugboard; *p; p += (p[2] ? 3 : 2)) {
+    board[board_size][0] = p[0];
+    board[board_size][1] = p[1];
+    board_size++;
+  }
+
+  memset(e, 0, sizeof(Enigma));
+  init_rotors(e, s->rotor_names, s->positions, s->rings);
+  init_reflector(e, s->reflector_name);
+  init_plugboard(e, board, board_size);
+}
+
+// Random position, biased towards the notch so that double steps
+// happen early and often within a message. Some positions are past
+// the end of the alphabet, which must wrap around.
+u8 random_position(const char *rotor_name) {
+#if ALPHABET_SIZE == CLASSIC_ALPHABET_SIZE
+  if (rand() % 8 == 0) {
+    return (u8) (ALPHABET_SIZE + rand() % (256 - ALPHABET_SIZE));
+  }
+#endif
+
+  for (usize i = 0; i < KNOWN_ROTORS_LENGTH; i++) {
+    if (strcmp(KNOWN_ROTORS[i].name, rotor_name) == 0 && rand() % 2) {
+      return (u8) ((KNOWN_ROTORS[i].notch + ALPHABET_SIZE - rand() % 3) % ALPHABET_SIZE);
+    }
+  }
+  return (u8) (rand() % ALPHABET_SIZE);
+}
+
+void random_enigma(Enigma *e) {
+  const char *rotor_names[ROTORS_N];
+  u8 positions[ROTORS_N], rings[ROTORS_N];
+
+  // distinct rotors from left to right
+  usize picked[ROTORS_N];
+  for (usize i = 0; i < ROTORS_N; i++) {
+    usize j;
+    do {
+      j = rand() % KNOWN_ROTORS_LENGTH;
+    } while ((i > 0 && picked[0] == j) || (i > 1 && picked[1] == j));
+    picked[i] = j;
+    rotor_names[i] = KNOWN_ROTORS[j].name;
+    positions[i] = random_position(rotor_names[i]);
+    rings[i] = (rand() % 8) ? rand() % ALPHABET_SIZE : rand() % 256;
+  }
+
+  // plugboard with distinct letters
+  u8 letters[ALPHABET_SIZE];
+  shuffle_codes(letters, ALPHABET_SIZE, (u32) rand() | 1);
+  usize board_size = rand() % (PLUGBOARD_SIZE + 1);
+  u8 board[PLUGBOARD_SIZE][2];
+  for (usize i = 0; i < board_size; i++) {
+    board[i][0] = CODE2CHAR(letters[2 * i]);
+    board[i][1] = CODE2CHAR(letters[2 * i + 1]);
+  }
+
+  memset(e, 0, sizeof(Enigma));
+  init_rotors(e, rotor_names, positions, rings);
+  init_reflector(e, KNOWN_REFLECTORS[rand() % KNOWN_REFLECTORS_LENGTH].name);
+  init_plugboard(e, board, board_size);
+}
+
+void print_enigma(Enigma *e) {
+  printf("        rotors %s %s %s, positions %d %d %d, rings %d %d %d, reflector %s, %zu plugs\n",
+	 e->rotors[2].name, e->rotors[1].name, e->rotors[0].name,
+	 e->rotors[2].position, e->rotors[1].position, e->rotors[0].position,
+	 e->rotors[2].ring, e->rotors[1].ring, e->rotors[0].ring,
+	 e->reflector.name, e->plugboard.board_size);
+}
+
+// --------------------------------------------------------------
+// CONFORMANCE
+
+// Sample messages are written for the historical wirings, which only
+// exist with the classic alphabet.
+int check_samples(void) {
+#if ALPHABET_SIZE != CLASSIC_ALPHABET_SIZE
+  printf("[--] sample messages skipped, they need the classic alphabet\n");
+  return 1;
+#endif
+
+  char output[MAX_MESSAGE_LEN];
+
+  for (usize k = 0; k < KERNELS_UNDER_TEST_LENGTH; k++) {
+    for (usize i = 0; i < SAMPLE_MESSAGES_LENGTH; i++) {
+      SampleMessage *s = &SAMPLE_MESSAGES[i];
+      usize len = strlen(s->input);
+
+      Enigma e;
+      sample_enigma(&e, s);
+      KERNELS_UNDER_TEST[k].kernel(&e, (const u8 *) s->input, len, (u8 *) output);
+
+      if (memcmp(output, s->output, len) != 0) {
+	printf("ERROR: kernel '%s' fails sample message '%s'\n",
+	       KERNELS_UNDER_TEST[k].name, s->name);
+	return 0;
+      }
+    }
+  }
+
+  printf("[OK] %zu kernels match %zu sample messages\n",
+	 KERNELS_UNDER_TEST_LENGTH, SAMPLE_MESSAGES_LENGTH);
+  return 1;
+}
+
+int check_random(void) {
+  u8 input[MAX_MESSAGE_LEN];
+  u8 expected[MAX_MESSAGE_LEN];
+  u8 actual[MAX_MESSAGE_LEN];
+
+  for (usize round = 0; round < ROUNDS; round++) {
+    Enigma initial;
+    random_enigma(&initial);
+
+    // lengths up to 2048 cross several turnovers of the middle rotor
+    usize len = rand() % MAX_MESSAGE_LEN;
+    for (usize i = 0; i < len; i++) {
+      // mostly letters, with a few symbols outside of the alphabet
+      input[i] = (rand() % 16) ? CODE2CHAR(rand() % ALPHABET_SIZE) : ' ';
+    }
+
+    Enigma reference = initial;
+    apply_enigma_reference(&reference, input, len, expected);
+
+    for (usize k = 0; k < KERNELS_UNDER_TEST_LENGTH; k++) {
+      Enigma e = initial;
+      KERNELS_UNDER_TEST[k].kernel(&e, input, len, actual);
+
+      if (memcmp(expected, actual, len) != 0 ||
+	  memcmp(&reference, &e, sizeof(Enigma)) != 0) {
+	printf("ERROR: kernel '%s' differs from reference (round %zu, length %zu)\n",
+	       KERNELS_UNDER_TEST[k].name, round, len);
+	print_enigma(&initial);
+	return 0;
+      }
+    }
+  }
+
+  printf("[OK] %zu kernels match reference on %d random configurations\n",
+	 KERNELS_UNDER_TEST_LENGTH, ROUNDS);
+  return 1;
+}
+
+// Every wheel order and reflector must be in the dispatch table, and
+// must be dispatched to a different kernel.
+int check_dispatch(void) {
+  usize checked = 0;
+  EnigmaKernel *seen = malloc(KERNEL_TABLE_LENGTH * sizeof(EnigmaKernel));
+  int ok = 1;
+
+  for (usize l = 0; l < KNOWN_ROTORS_LENGTH; l++) {
+    for (usize m = 0; m < KNOWN_ROTORS_LENGTH; m++) {
+      for (usize r = 0; r < KNOWN_ROTORS_LENGTH; r++) {
+	if (l == m || m == r || l == r) continue;
+	for (usize f = 0; f < KNOWN_REFLECTORS_LENGTH; f++) {
+	  Enigma e = {0};
+	  init_rotors(&e, (const char *[]){KNOWN_ROTORS[l].name, KNOWN_ROTORS[m].name, KNOWN_ROTORS[r].name},
+		      (const u8 [ROTORS_N]){0, 0, 0}, (const u8 [ROTORS_N]){0, 0, 0});
+	  init_reflector(&e, KNOWN_REFLECTORS[f].name);
+
+	  EnigmaKernel kernel = select_kernel(&e);
+	  if (kernel == apply_enigma) {
+	    printf("ERROR: no kernel for %s %s %s %s\n", KNOWN_ROTORS[l].name, KNOWN_ROTORS[m].name,
+		   KNOWN_ROTORS[r].name, KNOWN_REFLECTORS[f].name);
+	    ok = 0;
+	    continue;
+	  }
+	  for (usize i = 0; i < checked; i++) {
+	    if (seen[i] == kernel) {
+	      printf("ERROR: %s %s %s %s shares its kernel with another configuration\n", KNOWN_ROTORS[l].name,
+		     KNOWN_ROTORS[m].name, KNOWN_ROTORS[r].name, KNOWN_REFLECTORS[f].name);
+	      ok = 0;
+	    }
+	  }
+	  if (ok) {
+	    seen[checked++] = kernel;
+	  }
+	}
+      }
+    }
+  }
+
+  free(seen);
+  if (ok) {
+    printf("[OK] %zu configurations dispatched to their own kernel\n", checked);
+  }
+  return ok;
+}
+
+// Plugs outside of the alphabet would index the plugboard table out
+// of bounds, so they must be rejected before reaching a machine.
+int check_plugboard_validation(void) {
+#if ALPHABET_SIZE == CLASSIC_ALPHABET_SIZE
+  if (valid_plugboard((u8 [][2]){{'b', 'Q'}}, 1) ||
+      valid_plugboard((u8 [][2]){{'B', ' '}}, 1)) {
+    printf("ERROR: valid_plugboard() accepts plugs outside of the alphabet\n");
+    return 0;
+  }
+#endif
+
+  if (!valid_plugboard((u8 [][2]){{'B', 'Q'}, {'C', 'R'}}, 2) ||
+      valid_plugboard((u8 [][2]){{'A', 'B'}, {'C', 'D'}, {'E', 'F'}, {'G', 'H'}, {'I', 'J'}, {'K', 'L'},
+				  {'M', 'N'}, {'O', 'P'}, {'Q', 'R'}, {'S', 'T'}, {'U', 'V'}}, PLUGBOARD_SIZE + 1)) {
+    printf("ERROR: valid_plugboard() accepts plugs outside of the alphabet or too many plugs\n");
+    return 0;
+  }
+
+  printf("[OK] plugboards outside of the alphabet are rejected\n");
+  return 1;
+}
+
+// Machines and buffers from a pool must behave like the ones from
+// init_enigma() and the stack, also after being recycled many times.
+int check_pool(void) {
+  if (init_enigma_pool(SIZE_MAX / 2, 0, 1) ||
+      init_enigma_pool(0, SIZE_MAX / 2, 128) ||
+      init_enigma_pool(0, 1, SIZE_MAX) ||
+      init_enigma_pool(SIZE_MAX, 1, 1)) {
+    printf("ERROR: init_enigma_pool() accepts sizes that overflow\n");
+    return 0;
+  }
+
+  const usize machines_n = 8, buffers_n = 8;
+  EnigmaPool *p = init_enigma_pool(machines_n, buffers_n, MAX_MESSAGE_LEN);
+  SampleMessage *s = &SAMPLE_MESSAGES[0];
+  usize len = strlen(s->input);
+
+  Enigma expected;
+  sample_enigma(&expected, s);
+
+  // the sample output only holds with the classic alphabet
+  u8 expected_output[MAX_MESSAGE_LEN];
+  Enigma reference = expected;
+  apply_enigma_reference(&reference, (const u8 *) s->input, len, expected_output);
+
+  for (usize round = 0; round < 1000; round++) {
+    Enigma *machines[8];
+    u8 *buffers[8];
+
+    for (usize i = 0; i < machines_n; i++) {
+      machines[i] = pool_acquire_enigma(p, s->rotor_names, s->positions, s->rings,
+					s->reflector_name, (u8 [][2]){{'A', 'M'}, {'F', 'I'}, {'N', 'V'},
+								   {'P', 'S'}, {'T', 'U'}, {'W', 'Z'}}, 6);
+      buffers[i] = pool_acquire_buffer(p);
+
+      if (!machines[i] || !buffers[i] ||
+	  (uintptr_t) machines[i] % CACHE_LINE_SIZE != 0 ||
+	  (uintptr_t) buffers[i] % CACHE_LINE_SIZE != 0 ||
+	  memcmp(machines[i], &expected, sizeof(Enigma)) != 0) {
+	printf("ERROR: invalid machine or buffer from pool (round %zu)\n", round);
+	return 0;
+      }
+    }
+
+    if (pool_acquire_enigma(p, s->rotor_names, s->positions, s->rings, s->reflector_name, NULL, 0) ||
+	pool_acquire_buffer(p)) {
+      printf("ERROR: exhausted pool still hands out machines or buffers\n");
+      return 0;
+    }
+
+    for (usize i = 0; i < machines_n; i++) {
+      apply_enigma(machines[i], (const u8 *) s->input, len, buffers[i]);
+      if (memcmp(buffers[i], expected_output, len) != 0) {
+	printf("ERROR: machine from pool differs from reference on sample message '%s'\n", s->name);
+	return 0;
+      }
+    }
+
+    // release in a different order than acquisition
+    for (usize i = 0; i < machines_n; i++) {
+      pool_release_enigma(p, machines[(i * 3) % machines_n]);
+      pool_release_buffer(p, buffers[(i * 5) % buffers_n]);
+    }
+  }
+
+  destroy_enigma_pool(p);
+
+  printf("[OK] pool machines and buffers are aligned, recycled and match init_enigma()\n");
+  return 1;
+}
+
+// --------------------------------------------------------------
+// PERFORMANCE
+
+double now_seconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// Seconds spent by a single run of kernel over the benchmark message.
+double time_kernel(EnigmaKernel kernel, const u8 *input, u8 *output) {
+  Enigma e;
+  sample_enigma(&e, &SAMPLE_MESSAGES[0]);
+
+  double start = now_seconds();
+  kernel(&e, input, BENCH_MESSAGE_LEN, output);
+  return now_seconds() - start;
+}
+
+double read_baseline(const char *kernel_name) {
+  FILE *f = fopen(BASELINE_PATH, "r");
+  if (!f) {
+    return 0;
+  }
+
+  char name[LABEL_LENGTH];
+  double speedup, found = 0;
+  while (fscanf(f, "%41s %lf", name, &speedup) == 2) {
+    if (strcmp(name, kernel_name) == 0) {
+      found = speedup;
+    }
+  }
+
+  fclose(f);
+  return found;
+}
+
+// Absolute throughput depends on the host, so each kernel is judged by
+// its speedup over the reference measured in the same run. Runs of the
+// different kernels are interleaved and the best one of each is kept,
+// so that a noisy period affects all of them alike. The baseline is
+// recorded with the classic alphabet, so other builds skip this check.
+int check_throughput(int update_baseline) {
+#if ALPHABET_SIZE != CLASSIC_ALPHABET_SIZE
+  (void) update_baseline;
+  printf("[--] throughput skipped, the baseline is for the classic alphabet\n");
+  return 1;
+#endif
+
+  assert(KERNELS_UNDER_TEST[0].kernel == apply_enigma_reference && "reference must be the first kernel");
+  assert(KERNELS_UNDER_TEST_LENGTH <= MAX_KERNELS && "too many kernels under test");
+
+  u8 *input = malloc(BENCH_MESSAGE_LEN);
+  u8 *output = malloc(BENCH_MESSAGE_LEN);
+  for (usize i = 0; i < BENCH_MESSAGE_LEN; i++) {
+    input[i] = CODE2CHAR(rand() % ALPHABET_SIZE);
+  }
+
+  double best[MAX_KERNELS];
+  for (usize k = 0; k < KERNELS_UNDER_TEST_LENGTH; k++) {
+    best[k] = 1e9;
+  }
+  for (usize r = 0; r < BENCH_REPEATS; r++) {
+    for (usize k = 0; k < KERNELS_UNDER_TEST_LENGTH; k++) {
+      double elapsed = time_kernel(KERNELS_UNDER_TEST[k].kernel, input, output);
+      if (elapsed < best[k]) {
+	best[k] = elapsed;
+      }
+    }
+  }
+
+  FILE *f = NULL;
+  if (update_baseline) {
+    f = fopen(BASELINE_PATH, "w");
+    if (!f) {
+      printf("ERROR: cannot write %s\n", BASELINE_PATH);
+      return 0;
+    }
+  }
+
+  int ok = 1;
+  double reference_mchars = BENCH_MESSAGE_LEN / best[0] / 1e6;
+  if (reference_mchars < REFERENCE_FLOOR) {
+    printf("ERROR: %-10s %8.2f Mchars/s, below floor of %.2f Mchars/s\n",
+	   KERNELS_UNDER_TEST[0].name, reference_mchars, REFERENCE_FLOOR);
+    ok = 0;
+  } else {
+    printf("[OK] %-10s %8.2f Mchars/s\n", KERNELS_UNDER_TEST[0].name, reference_mchars);
+  }
+
+  for (usize k = 1; k < KERNELS_UNDER_TEST_LENGTH; k++) {
+    const char *name = KERNELS_UNDER_TEST[k].name;
+    double mchars = BENCH_MESSAGE_LEN / best[k] / 1e6;
+    double speedup = best[0] / best[k];
+
+    if (update_baseline) {
+      fprintf(f, "%s %.2f\n", name, speedup);
+      printf("[OK] %-10s %8.2f Mchars/s, %5.2fx reference (stored as baseline)\n", name, mchars, speedup);
+      continue;
+    }
+
+    double baseline = read_baseline(name);
+    if (baseline == 0) {
+      printf("[--] %-10s %8.2f Mchars/s, %5.2fx reference (no baseline)\n", name, mchars, speedup);
+    } else if (speedup < baseline * (1 - BENCH_TOLERANCE)) {
+      printf("ERROR: %-10s %8.2f Mchars/s, %5.2fx reference, below baseline of %.2fx\n", name, mchars, speedup, baseline);
+      ok = 0;
+    } else {
+      printf("[OK] %-10s %8.2f Mchars/s, %5.2fx reference (baseline %.2fx)\n", name, mchars, speedup, baseline);
+    }
+  }
+
+  if (f) {
+    fclose(f);
+  }
+  free(input);
+  free(output);
+  return ok;
+}
+
+// --------------------------------------------------------------
+
+int main(int argc, char **argv) {
+  int update_baseline = (argc > 1 && strcmp(argv[1], "--update-baseline") == 0);
+  int bench = update_baseline || (argc > 1 && strcmp(argv[1], "--bench") == 0);
+
+  init_default_alphabet();
+  srand(42);
+
+  if (!check_dispatch() || !check_samples() || !check_random() || !check_plugboard_validation() || !check_pool()) {
+    return 1;
+  }
+  if (bench && !check_throughput(update_baseline)) {
+    return 1;
+  }
+
+  printf("All good!\n");
+  return 0;
+}
@@ -0,0 +1,285 @@
+// Generates enigma_kernels.h, which contains one specialized encrypt
+// function for each wheel order and reflector of the known models.
+//
+// Within a kernel the wirings are baked in as static const tables, so
+// the only state read from the Enigma struct is the rotor positions,
+// the ring settings and the plugboard.
+//
+//   ./tools/gen_kernels > enigma_kernels.h
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define ENIGMA_IMPLEMENTATION
+#include "../enigma.h"
+
+// --------------------------------------------------------------
+
+// Model names contain '-', which cannot be used in C identifiers.
+void print_ident(const char *name) {
+  for (const char *c = name; *c; c++) {
+    putchar(*c == '-' ? '_' : *c);
+  }
+}
+
+// Each rotor direction is emitted as a table indexed by the rotor
+// offset (position - ring) and by the input code, so that a whole
+// apply_rotor() becomes a single load.
+void print_rotor_table(const char *name, const char *direction, Wiring wiring) {
+  printf("static const u8 KERNEL_");
+  print_ident(name);
+  printf("_%s[ALPHABET_SIZE][ALPHABET_SIZE] = {\n", direction);
+  for (usize offset = 0; offset < ALPHABET_SIZE; offset++) {
+    printf("  {");
+    for (usize code = 0; code < ALPHABET_SIZE; code++) {
+      u8 out = wiring[(code + offset) % ALPHABET_SIZE];
+      out = (u8) ((out + ALPHABET_SIZE - offset) % ALPHABET_SIZE);
+      printf("%s%2d", code ? "," : "", out);
+    }
+    printf("},\n");
+  }
+  printf("};\n\n");
+}
+
+void print_reflector_table(const char *name, Wiring wiring) {
+  printf("static const u8 KERNEL_");
+  print_ident(name);
+  printf("[ALPHABET_SIZE] = {");
+  for (usize code = 0; code < ALPHABET_SIZE; code++) {
+    printf("%s%d", code ? "," : "", wiring[code]);
+  }
+  printf("};\n\n");
+}
+
+void print_kernel_name(usize left, usize middle, usize right, usize reflector) {
+  printf("kernel_");
+  print_ident(KNOWN_ROTORS[left].name);
+  printf("__");
+  print_ident(KNOWN_ROTORS[middle].name);
+  printf("__");
+  print_ident(KNOWN_ROTORS[right].name);
+  printf("__");
+  print_ident(KNOWN_REFLECTORS[reflector].name);
+}
+
+void print_header(void) {
+  printf("// Generated by tools/gen_kernels.c, do not edit.\n");
+  printf("//\n");
+  printf("// Specialized kernels for each wheel order and reflector. Include it\n");
+  printf("// right after enigma.h and pick a kernel with select_kernel().\n");
+  printf("\n");
+  printf("#ifndef ENIGMA_KERNELS_H_\n");
+  printf("#define ENIGMA_KERNELS_H_\n");
+  printf("\n");
+  printf("#if ALPHABET_SIZE != %d\n", ALPHABET_SIZE);
+  printf("#error \"enigma_kernels.h was generated for ALPHABET_SIZE %d\"\n", ALPHABET_SIZE);
+  printf("#endif\n");
+  printf("\n");
+  printf("typedef void (*EnigmaKernel)(Enigma *e, const u8 *input, usize input_len, u8 *output);\n");
+  printf("\n");
+  printf("typedef struct {\n");
+  printf("  const char *rotor_names[ROTORS_N]; // from left to right\n");
+  printf("  const char *reflector_name;\n");
+  printf("  EnigmaKernel kernel;\n");
+  printf("} KernelEntry;\n");
+  printf("\n");
+  printf("EnigmaKernel select_kernel(const Enigma *e);\n");
+  printf("\n");
+  printf("#endif // ENIGMA_KERNELS_H_\n");
+  printf("\n");
+  printf("#ifdef ENIGMA_IMPLEMENTATION\n");
+  printf("\n");
+}
+
+// Lines of a multi-line macro, with the trailing backslashes aligned.
+void print_macro_line(const char *line) {
+  printf("%-88s\\\n", line);
+}
+
+// Same logic of apply_enigma(), with the wirings supplied as
+// compile-time constant tables. Between two notch events only the
+// right rotor moves, so the input is processed in spans during which
+// the offsets of the middle and left rotors stay the same.
+void print_kernel_body(void) {
+  print_macro_line("#define KERNEL_ENCRYPT(C, O0, O1, O2)");
+  print_macro_line("  C = plugboard[C];");
+  print_macro_line("  C = r0_fw[O0][C];");
+  print_macro_line("  C = r1_fw[O1][C];");
+  print_macro_line("  C = r2_fw[O2][C];");
+  print_macro_line("  C = reflector[C];");
+  print_macro_line("  C = r2_bw[O2][C];");
+  print_macro_line("  C = r1_bw[O1][C];");
+  print_macro_line("  C = r0_bw[O0][C];");
+  printf("  C = plugboard[C];\n");
+  printf("\n");
+  print_macro_line("#define KERNEL_BODY(R0_FW, R0_BW, N0, R1_FW, R1_BW, N1, R2_FW, R2_BW, N2, REFLECTOR)");
+  print_macro_line("  const u8 (*r0_fw)[ALPHABET_SIZE] = R0_FW;");
+  print_macro_line("  const u8 (*r0_bw)[ALPHABET_SIZE] = R0_BW;");
+  print_macro_line("  const u8 (*r1_fw)[ALPHABET_SIZE] = R1_FW;");
+  print_macro_line("  const u8 (*r1_bw)[ALPHABET_SIZE] = R1_BW;");
+  print_macro_line("  const u8 (*r2_fw)[ALPHABET_SIZE] = R2_FW;");
+  print_macro_line("  const u8 (*r2_bw)[ALPHABET_SIZE] = R2_BW;");
+  print_macro_line("  const u8 *reflector = REFLECTOR;");
+  print_macro_line("");
+  print_macro_line("  u8 plugboard[ALPHABET_SIZE];");
+  print_macro_line("  init_plugboard_table(e, plugboard);");
+  print_macro_line("");
+  print_macro_line("  u8 p0 = e->rotors[0].position;");
+  print_macro_line("  u8 p1 = e->rotors[1].position;");
+  print_macro_line("  u8 p2 = e->rotors[2].position;");
+  print_macro_line("  const u8 g0 = e->rotors[0].ring;");
+  print_macro_line("  const u8 g1 = e->rotors[1].ring;");
+  print_macro_line("  const u8 g2 = e->rotors[2].ring;");
+  print_macro_line("");
+  print_macro_line("  usize i = 0;");
+  print_macro_line("  while (i < input_len) {");
+  print_macro_line("    usize span = (p1 == (N1)) ? 0 : ((N0) + ALPHABET_SIZE - p0) % ALPHABET_SIZE;");
+  print_macro_line("    u8 o0;");
+  print_macro_line("    u8 o1 = (u8) ((p1 + ALPHABET_SIZE - g1) % ALPHABET_SIZE);");
+  print_macro_line("    u8 o2 = (u8) ((p2 + ALPHABET_SIZE - g2) % ALPHABET_SIZE);");
+  print_macro_line("");
+  print_macro_line("    for (; i < input_len; i++) {");
+  print_macro_line("      u8 c = CHAR2CODE(input[i]);");
+  // A macro cannot hold an #if, so the check for symbols outside of the
+  // alphabet is only emitted when there can be any.
+#if ALPHABET_SIZE < 256
+  print_macro_line("      if (c == INVALID_CODE) {");
+  print_macro_line("        output[i] = input[i];");
+  print_macro_line("        continue;");
+  print_macro_line("      }");
+#endif
+  print_macro_line("      if (span == 0) {");
+  print_macro_line("        break;");
+  print_macro_line("      }");
+  print_macro_line("      span--;");
+  print_macro_line("");
+  print_macro_line("      p0 = (p0 + 1 == ALPHABET_SIZE) ? 0 : p0 + 1;");
+  print_macro_line("      o0 = (u8) ((p0 + ALPHABET_SIZE - g0) % ALPHABET_SIZE);");
+  print_macro_line("      KERNEL_ENCRYPT(c, o0, o1, o2);");
+  print_macro_line("      output[i] = (u8) CODE2CHAR(c);");
+  print_macro_line("    }");
+  print_macro_line("");
+  print_macro_line("    if (i < input_len) {");
+  print_macro_line("      if (p1 == (N1)) {");
+  print_macro_line("        p2 = (u8) ((p2 + 1) % ALPHABET_SIZE);");
+  print_macro_line("        p1 = (u8) ((p1 + 1) % ALPHABET_SIZE);");
+  print_macro_line("      } else if (p0 == (N0)) {");
+  print_macro_line("        p1 = (u8) ((p1 + 1) % ALPHABET_SIZE);");
+  print_macro_line("      }");
+  print_macro_line("      p0 = (u8) ((p0 + 1) % ALPHABET_SIZE);");
+  print_macro_line("");
+  print_macro_line("      o0 = (u8) ((p0 + ALPHABET_SIZE - g0) % ALPHABET_SIZE);");
+  print_macro_line("      o1 = (u8) ((p1 + ALPHABET_SIZE - g1) % ALPHABET_SIZE);");
+  print_macro_line("      o2 = (u8) ((p2 + ALPHABET_SIZE - g2) % ALPHABET_SIZE);");
+  print_macro_line("");
+  print_macro_line("      u8 c = CHAR2CODE(input[i]);");
+  print_macro_line("      KERNEL_ENCRYPT(c, o0, o1, o2);");
+  print_macro_line("      output[i] = (u8) CODE2CHAR(c);");
+  print_macro_line("      i++;");
+  print_macro_line("    }");
+  print_macro_line("  }");
+  print_macro_line("");
+  print_macro_line("  e->rotors[0].position = p0;");
+  print_macro_line("  e->rotors[1].position = p1;");
+  printf("  e->rotors[2].position = p2;\n");
+  printf("\n");
+}
+
+void print_kernel(usize left, usize middle, usize right, usize reflector) {
+  // rotors are stored from right (index 0) to left (index 2)
+  usize rotors[ROTORS_N] = {right, middle, left};
+
+  printf("void ");
+  print_kernel_name(left, middle, right, reflector);
+  printf("(Enigma *e, const u8 *input, usize input_len, u8 *output) {\n");
+  printf("  KERNEL_BODY(");
+  for (usize i = 0; i < ROTORS_N; i++) {
+    printf("KERNEL_");
+    print_ident(KNOWN_ROTORS[rotors[i]].name);
+    printf("_FW, KERNEL_");
+    print_ident(KNOWN_ROTORS[rotors[i]].name);
+    printf("_BW, %d, ", KNOWN_ROTORS[rotors[i]].notch % ALPHABET_SIZE);
+  }
+  printf("KERNEL_");
+  print_ident(KNOWN_REFLECTORS[reflector].name);
+  printf(")\n");
+  printf("}\n\n");
+}
+
+void print_dispatch_table(void) {
+  printf("KernelEntry KERNEL_TABLE[] = {\n");
+  for (usize l = 0; l < KNOWN_ROTORS_LENGTH; l++) {
+    for (usize m = 0; m < KNOWN_ROTORS_LENGTH; m++) {
+      for (usize r = 0; r < KNOWN_ROTORS_LENGTH; r++) {
+	if (l == m || m == r || l == r) continue;
+	for (usize f = 0; f < KNOWN_REFLECTORS_LENGTH; f++) {
+	  printf("  {{\"%s\", \"%s\", \"%s\"}, \"%s\", ",
+		 KNOWN_ROTORS[l].name, KNOWN_ROTORS[m].name,
+		 KNOWN_ROTORS[r].name, KNOWN_REFLECTORS[f].name);
+	  print_kernel_name(l, m, r, f);
+	  printf("},\n");
+	}
+      }
+    }
+  }
+  printf("};\n\n");
+  printf("usize KERNEL_TABLE_LENGTH = (sizeof(KERNEL_TABLE)/sizeof(KernelEntry));\n\n");
+}
+
+void print_select_kernel(void) {
+  printf("// Returns the kernel specialized for the rotors and the reflector\n");
+  printf("// currently installed in e, or apply_enigma() if there is none.\n");
+  printf("EnigmaKernel select_kernel(const Enigma *e) {\n");
+  printf("  for (usize i = 0; i < KERNEL_TABLE_LENGTH; i++) {\n");
+  printf("    KernelEntry *k = &KERNEL_TABLE[i];\n");
+  printf("    if (strcmp(k->rotor_names[0], e->rotors[2].name) == 0 &&\n");
+  printf("\tstrcmp(k->rotor_names[1], e->rotors[1].name) == 0 &&\n");
+  printf("\tstrcmp(k->rotor_names[2], e->rotors[0].name) == 0 &&\n");
+  printf("\tstrcmp(k->reflector_name, e->reflector.name) == 0) {\n");
+  printf("      return k->kernel;\n");
+  printf("    }\n");
+  printf("  }\n");
+  printf("  return apply_enigma;\n");
+  printf("}\n\n");
+}
+
+// --------------------------------------------------------------
+
+int main() {
+  init_default_alphabet();
+
+  print_header();
+
+  for (usize i = 0; i < KNOWN_ROTORS_LENGTH; i++) {
+    Rotor r = {0};
+    init_rotor(&r, KNOWN_ROTORS[i].name, 0, 0);
+    print_rotor_table(r.name, "FW", r.forward_wiring);
+    print_rotor_table(r.name, "BW", r.backward_wiring);
+  }
+
+  for (usize i = 0; i < KNOWN_REFLECTORS_LENGTH; i++) {
+    Enigma e = {0};
+    init_reflector(&e, KNOWN_REFLECTORS[i].name);
+    print_reflector_table(e.reflector.name, e.reflector.wiring);
+  }
+
+  print_kernel_body();
+
+  for (usize l = 0; l < KNOWN_ROTORS_LENGTH; l++) {
+    for (usize m = 0; m < KNOWN_ROTORS_LENGTH; m++) {
+      for (usize r = 0; r < KNOWN_ROTORS_LENGTH; r++) {
+	if (l == m || m == r || l == r) continue;
+	for (usize f = 0; f < KNOWN_REFLECTORS_LENGTH; f++) {
+	  print_kernel(l, m, r, f);
+	}
+      }
+    }
+  }
+
+  print_dispatch_table();
+  print_select_kernel();
+
+  printf("#endif // ENIGMA_IMPLEMENTATION\n");
+
+  return 0;
+}